@@ -1,10 +1,10 @@
 #include <SDL2/SDL.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <stdint.h>
 
-//TODO: implement sine ourselves
-#include <math.h>
+#include "scratch_math.h"
 
 /* Use these aliases instead of static for clarity */
 #define internal static
@@ -55,9 +55,45 @@ struct sdl_audio_ring_buffer
     int Size;         // Buffer size in Bytes
     int WriteCursor;  // Index within buffer after which we can safely write
     int PlayCursor;   // Index of the next sample to be uploaded
+    int BytesBuffered; // Bytes written but not yet consumed by the callback, negative after an underrun
     void *Data;       // Pointer to our audio data
 };
 
+struct sdl_audio_queue
+{
+    SDL_AudioDeviceID Device;
+    int Size;         // Size in Bytes of Staging
+    void *Staging;    // Linear scratch the generator writes into before queueing
+    bool Started;     // Set once we have queued something, for underrun checks
+};
+
+/*
+ * NOTE(Alex): Two ways of getting samples to SDL. Callback is the original
+ * one: SDL's audio thread pulls out of GlobalSecondaryBuffer. Queue pushes
+ * from the main loop with SDL_QueueAudio and never touches the ring buffer.
+ * Pick one on the command line (--audio=callback / --audio=queue).
+ */
+enum sdl_audio_backend
+{
+    AudioBackend_Callback,
+    AudioBackend_Queue,
+};
+
+/*
+ * Both backends fill this in the same way so we can compare them.
+ * Latency is the audio buffered ahead of the device (not counting the
+ * device's own 512 sample buffer), sampled once per frame right before we
+ * top it up, so it is the low-water mark for that frame.
+ */
+struct sdl_audio_stats
+{
+    int UnderrunCount;
+    int LatencyBytes;
+    int MinLatencyBytes;
+    int MaxLatencyBytes;
+    uint64 WorkTicks;  // Performance counter ticks spent producing/copying audio
+};
+
 struct sdl_sound_output
 {
     int SamplesPerSecond;
@@ -73,6 +109,8 @@ struct sdl_sound_output
 
 global_variable sdl_offscreen_buffer GlobalBackbuffer;
 global_variable sdl_audio_ring_buffer GlobalSecondaryBuffer;
+global_variable sdl_audio_queue GlobalAudioQueue;
+global_variable sdl_audio_stats GlobalAudioStats;
 
 SDL_GameController *ControllerHandles[MAX_CONTROLLERS];
 SDL_Haptic *RumbleHandles[MAX_CONTROLLERS];
@@ -97,6 +135,21 @@ internal void
 SDLAudioCallback(void *UserData, uint8 *AudioData, int Length)
 {
     sdl_audio_ring_buffer *RingBuffer = (sdl_audio_ring_buffer *)UserData;
+    uint64 StartTicks = SDL_GetPerformanceCounter();
+
+    /* If the main loop has not written Length bytes ahead of us, we are
+     * about to play stale samples.
+     *
+     * NOTE(Alex): BytesBuffered is allowed to go negative here, PlayCursor
+     * moves on by Length either way. The main loop resyncs the counter from
+     * the cursors every frame, so however deep this goes it is corrected on
+     * the next fill.
+     */
+    RingBuffer->BytesBuffered -= Length;
+    if (RingBuffer->BytesBuffered < 0)
+    {
+        ++GlobalAudioStats.UnderrunCount;
+    }
 
     //TODO: Make sure you go back and figure out what's really happening here
     // Region1Size refers to the current sample?
@@ -117,6 +170,8 @@ SDLAudioCallback(void *UserData, uint8 *AudioData, int Length)
     memcpy(AudioData + Region1Size, RingBuffer->Data, Region2Size);
     RingBuffer->PlayCursor = (RingBuffer->PlayCursor + Length) % RingBuffer->Size;
     RingBuffer->WriteCursor = (RingBuffer->PlayCursor + Length) % RingBuffer->Size;
+
+    GlobalAudioStats.WorkTicks += SDL_GetPerformanceCounter() - StartTicks;
 }
 
 
@@ -148,6 +203,7 @@ SDLInitAudio(int32 SamplesPerSecond, int32 BufferSize)
     GlobalSecondaryBuffer.Size = BufferSize;
     GlobalSecondaryBuffer.Data = calloc(BufferSize, 1);
     GlobalSecondaryBuffer.PlayCursor = GlobalSecondaryBuffer.WriteCursor = 0;
+    GlobalSecondaryBuffer.BytesBuffered = 0;
 
     SDL_OpenAudio(&AudioSettings, 0);
     
@@ -170,6 +226,127 @@ SDLInitAudio(int32 SamplesPerSecond, int32 BufferSize)
     }
 }
 
+/*
+ * Opens a device with no callback. Samples only reach it through
+ * SDL_QueueAudio, see SDLQueueSoundBuffer.
+ *
+ * BufferSize is the most we will ever queue in one go, it sizes the staging
+ * memory the generator writes into.
+ */
+internal void
+SDLInitQueuedAudio(int32 SamplesPerSecond, int32 BufferSize)
+{
+    SDL_AudioSpec AudioSettings = {};
+    AudioSettings.freq = SamplesPerSecond;
+    AudioSettings.format = AUDIO_S16LSB; /* Signed 16-bit Little Endian */
+    AudioSettings.channels = 2; /* Stereo sound */
+    AudioSettings.samples = 512;
+    AudioSettings.callback = 0; /* No callback means we push with SDL_QueueAudio */
+
+    GlobalAudioQueue.Size = BufferSize;
+    GlobalAudioQueue.Staging = calloc(BufferSize, 1);
+    GlobalAudioQueue.Started = false;
+
+    /* NOTE(Alex):
+     * allowed_changes is 0, so if the hardware wants something else SDL
+     * converts behind our back and we always get exactly what we asked for.
+     */
+    GlobalAudioQueue.Device = SDL_OpenAudioDevice(0, 0, &AudioSettings, 0, 0);
+    if (GlobalAudioQueue.Device == 0)
+    {
+        fprintf(stderr, "Could not open a queued audio device: %s\n", SDL_GetError());
+        return;
+    }
+
+    int AudioBufferSize = AudioSettings.channels * AudioSettings.samples * sizeof(int16);
+    printf("Intialized a queued audio device!\n"
+            "Frequencey: %d Hz\n"
+            "Channels: %d\n"
+            "Audio Buffer Size: %d\n",
+            AudioSettings.freq,
+            AudioSettings.channels,
+            AudioBufferSize);
+}
+
+/*
+ * Writes SampleCount stereo samples of the test tone starting at SampleOut and
+ * advances the tone phase to match.
+ *
+ * NOTE(Alex): tSine gets wrapped back into [0, 2*Pi) as we go. It used to
+ * grow forever, which slowly eats the float precision of the phase and would
+ * eventually walk it out of the range Sin() is accurate for.
+ */
+internal void
+SDLWriteSineSamples(sdl_sound_output *SoundOutput, int16 *SampleOut, int SampleCount)
+{
+    real32 Step = (2.0f * Pi32 * 1.0f) / ((real32)SoundOutput->WavePeriod);
+    int SampleIndex = 0;
+
+#if defined(__AVX2__)
+    __m256 LaneSteps = _mm256_mul_ps(_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps(Step));
+    __m256 Volume = _mm256_set1_ps((real32)SoundOutput->ToneVolume);
+    for (;
+        SampleIndex + 8 <= SampleCount;
+        SampleIndex += 8)
+    {
+        __m256 Phase = _mm256_add_ps(_mm256_set1_ps(SoundOutput->tSine), LaneSteps);
+        __m256i Values = _mm256_cvttps_epi32(_mm256_mul_ps(Sin_8x(Phase), Volume));
+
+        /* Narrow to int16 and duplicate each value into the L and R slots */
+        __m128i Packed = _mm_packs_epi32(_mm256_castsi256_si128(Values),
+                                         _mm256_extracti128_si256(Values, 1));
+        _mm_storeu_si128((__m128i *)SampleOut, _mm_unpacklo_epi16(Packed, Packed));
+        _mm_storeu_si128((__m128i *)SampleOut + 1, _mm_unpackhi_epi16(Packed, Packed));
+        SampleOut += 16;
+
+        SoundOutput->tSine += 8.0f * Step;
+        if (SoundOutput->tSine >= 2.0f * Pi32)
+        {
+            SoundOutput->tSine -= 2.0f * Pi32;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128 LaneSteps = _mm_mul_ps(_mm_setr_ps(0, 1, 2, 3), _mm_set1_ps(Step));
+    __m128 Volume = _mm_set1_ps((real32)SoundOutput->ToneVolume);
+    for (;
+        SampleIndex + 4 <= SampleCount;
+        SampleIndex += 4)
+    {
+        __m128 Phase = _mm_add_ps(_mm_set1_ps(SoundOutput->tSine), LaneSteps);
+        __m128i Values = _mm_cvttps_epi32(_mm_mul_ps(Sin_4x(Phase), Volume));
+
+        /* Narrow to int16 and duplicate each value into the L and R slots */
+        __m128i Packed = _mm_packs_epi32(Values, Values);
+        _mm_storeu_si128((__m128i *)SampleOut, _mm_unpacklo_epi16(Packed, Packed));
+        SampleOut += 8;
+
+        SoundOutput->tSine += 4.0f * Step;
+        if (SoundOutput->tSine >= 2.0f * Pi32)
+        {
+            SoundOutput->tSine -= 2.0f * Pi32;
+        }
+    }
+#endif
+
+    for (;
+        SampleIndex < SampleCount;
+        ++SampleIndex)
+    {
+        real32 SineValue = Sin(SoundOutput->tSine);
+        int16 SampleValue = (int16)(SineValue * SoundOutput->ToneVolume);
+        *SampleOut++ = SampleValue;
+        *SampleOut++ = SampleValue;
+
+        SoundOutput->tSine += Step;
+        if (SoundOutput->tSine >= 2.0f * Pi32)
+        {
+            SoundOutput->tSine -= 2.0f * Pi32;
+        }
+    }
+
+    SoundOutput->RunningSampleIndex += SampleCount;
+}
+
 internal void
 SDLFillSoundBuffer(sdl_sound_output *SoundOutput, int ByteToLock, int BytesToWrite)
 {
@@ -185,36 +362,99 @@ SDLFillSoundBuffer(sdl_sound_output *SoundOutput, int ByteToLock, int BytesToWri
     int Region2Size = BytesToWrite - Region1Size;
 
     int Region1SampleCount = Region1Size / SoundOutput->BytesPerSample;
-    int16 *SampleOut = (int16 *)Region1;
-    
-    for (int SampleIndex = 0;
-        SampleIndex < Region1SampleCount;
-        ++SampleIndex)
+    SDLWriteSineSamples(SoundOutput, (int16 *)Region1, Region1SampleCount);
+
+    int Region2SampleCount = Region2Size / SoundOutput->BytesPerSample;
+    SDLWriteSineSamples(SoundOutput, (int16 *)Region2, Region2SampleCount);
+}
+
+internal void
+SDLRecordAudioLatency(sdl_audio_stats *Stats, int LatencyBytes)
+{
+    Stats->LatencyBytes = LatencyBytes;
+    if (LatencyBytes < Stats->MinLatencyBytes)
     {
-        real32 SineValue = sinf(SoundOutput->tSine);
-        int16 SampleValue = (int16)(SineValue * SoundOutput->ToneVolume);
-        *SampleOut++ = SampleValue;
-        *SampleOut++ = SampleValue;
+        Stats->MinLatencyBytes = LatencyBytes;
+    }
+    if (LatencyBytes > Stats->MaxLatencyBytes)
+    {
+        Stats->MaxLatencyBytes = LatencyBytes;
+    }
+}
+
+/*
+ * Push-model replacement for the ring buffer + callback. Once per frame we
+ * ask SDL how much is still waiting to be played and generate straight into
+ * the staging memory until the queue is back at LatencySampleCount.
+ *
+ * NOTE(Alex): We can only see an underrun if the queue is completely empty
+ * when we look at it, so a device that starved and recovered between two
+ * frames will not be counted.
+ */
+internal void
+SDLQueueSoundBuffer(sdl_sound_output *SoundOutput)
+{
+    if (GlobalAudioQueue.Device == 0)
+    {
+        return;
+    }
+
+    uint64 StartTicks = SDL_GetPerformanceCounter();
+
+    int TargetQueueBytes = SoundOutput->LatencySampleCount * SoundOutput->BytesPerSample;
+    int QueuedBytes = (int)SDL_GetQueuedAudioSize(GlobalAudioQueue.Device);
 
-        SoundOutput->tSine += (2.0f * Pi32 * 1.0f) / ((real32)SoundOutput->WavePeriod);
-        ++SoundOutput->RunningSampleIndex;
+    if (GlobalAudioQueue.Started && QueuedBytes == 0)
+    {
+        ++GlobalAudioStats.UnderrunCount;
     }
+    SDLRecordAudioLatency(&GlobalAudioStats, QueuedBytes);
 
-    int Region2SampleCount = Region2Size / SoundOutput->BytesPerSample;
-    SampleOut = (int16 *)Region2;
-    
-    for (int SampleIndex = 0;
-        SampleIndex < Region2SampleCount;
-        ++SampleIndex)
+    if (QueuedBytes < TargetQueueBytes)
     {
-        real32 SineValue = sinf(SoundOutput->tSine);
-        int16 SampleValue = (int16)(SineValue * SoundOutput->ToneVolume);
-        *SampleOut++ = SampleValue;
-        *SampleOut++ = SampleValue;
+        int BytesToWrite = TargetQueueBytes - QueuedBytes;
+        if (BytesToWrite > GlobalAudioQueue.Size)
+        {
+            BytesToWrite = GlobalAudioQueue.Size;
+        }
 
-        SoundOutput->tSine += (2.0f * Pi32 * 1.0f) / ((real32)SoundOutput->WavePeriod);
-        ++SoundOutput->RunningSampleIndex;
+        int SampleCount = BytesToWrite / SoundOutput->BytesPerSample;
+        SDLWriteSineSamples(SoundOutput, (int16 *)GlobalAudioQueue.Staging, SampleCount);
+        SDL_QueueAudio(GlobalAudioQueue.Device,
+                       GlobalAudioQueue.Staging,
+                       SampleCount * SoundOutput->BytesPerSample);
+        GlobalAudioQueue.Started = true;
     }
+
+    GlobalAudioStats.WorkTicks += SDL_GetPerformanceCounter() - StartTicks;
+}
+
+/*
+ * Prints what the audio backend has been doing since the last report and
+ * starts a new window. ElapsedTicks is the length of that window in
+ * performance counter ticks.
+ *
+ * For the callback backend the audio thread writes into GlobalAudioStats, so
+ * call this with the audio locked.
+ */
+internal void
+SDLReportAudioStats(sdl_audio_backend Backend, sdl_sound_output *SoundOutput, uint64 ElapsedTicks)
+{
+    sdl_audio_stats *Stats = &GlobalAudioStats;
+    real32 BytesPerMs = (real32)(SoundOutput->SamplesPerSecond * SoundOutput->BytesPerSample) / 1000.0f;
+    real32 CPUPercent = 100.0f * (real32)Stats->WorkTicks / (real32)ElapsedTicks;
+
+    printf("Audio (%s): latency %.1fms (min %.1fms, max %.1fms), underruns %d, audio CPU %.2f%%\n",
+           (Backend == AudioBackend_Queue) ? "queue" : "callback",
+           Stats->LatencyBytes / BytesPerMs,
+           Stats->MinLatencyBytes / BytesPerMs,
+           Stats->MaxLatencyBytes / BytesPerMs,
+           Stats->UnderrunCount,
+           CPUPercent);
+
+    Stats->MinLatencyBytes = Stats->LatencyBytes;
+    Stats->MaxLatencyBytes = Stats->LatencyBytes;
+    Stats->WorkTicks = 0;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -534,8 +774,30 @@ SDLCloseGameControllers()
 }
 
 
+/* NOTE(Alex):
+ * sdl_scratch_bench.cpp #includes this whole file to get at the internal
+ * functions and brings its own main, so it defines SCRATCH_NO_MAIN first.
+ */
+#if !defined(SCRATCH_NO_MAIN)
 int main(int argc, char *argv[])
 {
+    sdl_audio_backend AudioBackend = AudioBackend_Callback;
+    for (int ArgIndex = 1; ArgIndex < argc; ++ArgIndex)
+    {
+        if (strcmp(argv[ArgIndex], "--audio=callback") == 0)
+        {
+            AudioBackend = AudioBackend_Callback;
+        }
+        else if (strcmp(argv[ArgIndex], "--audio=queue") == 0)
+        {
+            AudioBackend = AudioBackend_Queue;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument %s (expected --audio=callback or --audio=queue)\n", argv[ArgIndex]);
+        }
+    }
+
     /*Initialize Graphics and Controllers*/
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER | SDL_INIT_HAPTIC | SDL_INIT_AUDIO);
     
@@ -576,10 +838,25 @@ int main(int argc, char *argv[])
             SoundOutput.tSine = 0.0f;
             SoundOutput.LatencySampleCount = SoundOutput.SamplesPerSecond / 15;
 
+            GlobalAudioStats.MinLatencyBytes = INT32_MAX;
+
             // Open Audio Device
-            SDLInitAudio(48000, SoundOutput.SecondaryBufferSize);
-            SDLFillSoundBuffer(&SoundOutput, 0, SoundOutput.LatencySampleCount * SoundOutput.BytesPerSample);
-            SDL_PauseAudio(0);
+            if (AudioBackend == AudioBackend_Queue)
+            {
+                SDLInitQueuedAudio(48000, SoundOutput.SecondaryBufferSize);
+                SDLQueueSoundBuffer(&SoundOutput);
+                SDL_PauseAudioDevice(GlobalAudioQueue.Device, 0);
+            }
+            else
+            {
+                SDLInitAudio(48000, SoundOutput.SecondaryBufferSize);
+                SDLFillSoundBuffer(&SoundOutput, 0, SoundOutput.LatencySampleCount * SoundOutput.BytesPerSample);
+                GlobalSecondaryBuffer.BytesBuffered = SoundOutput.LatencySampleCount * SoundOutput.BytesPerSample;
+                SDL_PauseAudio(0);
+            }
+
+            uint64 PerfCountFrequency = SDL_GetPerformanceFrequency();
+            uint64 LastAudioReport = SDL_GetPerformanceCounter();
 
             while (Running)
             {
@@ -647,24 +924,62 @@ int main(int argc, char *argv[])
                 RenderWeirdGradient(&GlobalBackbuffer, XOffset, YOffset);
                 
                 // SOUND TEST----------------------------------------------
-                SDL_LockAudio();
-                int ByteToLock = (SoundOutput.RunningSampleIndex * SoundOutput.BytesPerSample) % SoundOutput.SecondaryBufferSize;
-                int TargetCursor = ((GlobalSecondaryBuffer.PlayCursor + 
-                                    (SoundOutput.LatencySampleCount * SoundOutput.BytesPerSample)) %
-                                    SoundOutput.SecondaryBufferSize);
-                int BytesToWrite;
-                if (ByteToLock > TargetCursor)
+                if (AudioBackend == AudioBackend_Queue)
                 {
-                    BytesToWrite = SoundOutput.SecondaryBufferSize - ByteToLock;
-                    BytesToWrite += TargetCursor;
+                    SDLQueueSoundBuffer(&SoundOutput);
                 }
                 else
                 {
-                    BytesToWrite = TargetCursor - ByteToLock;
+                    SDL_LockAudio();
+                    int ByteToLock = (SoundOutput.RunningSampleIndex * SoundOutput.BytesPerSample) % SoundOutput.SecondaryBufferSize;
+                    int TargetCursor = ((GlobalSecondaryBuffer.PlayCursor + 
+                                        (SoundOutput.LatencySampleCount * SoundOutput.BytesPerSample)) %
+                                        SoundOutput.SecondaryBufferSize);
+                    int BytesToWrite;
+                    if (ByteToLock > TargetCursor)
+                    {
+                        BytesToWrite = SoundOutput.SecondaryBufferSize - ByteToLock;
+                        BytesToWrite += TargetCursor;
+                    }
+                    else
+                    {
+                        BytesToWrite = TargetCursor - ByteToLock;
+                    }
+
+                    /* NOTE(Alex):
+                     * After this fill the ring holds exactly LatencyBytes ahead of
+                     * PlayCursor (mod Size), so whatever was valid before it is
+                     * LatencyBytes - BytesToWrite. Taking that from the cursors
+                     * instead of trusting the running count matters after a long
+                     * stall (debugger, dragged window): the callback can get more
+                     * than a whole ring ahead, and the modulo above then refills
+                     * short by a multiple of Size, which a running count would
+                     * never recover from.
+                     */
+                    int LatencyBytes = SoundOutput.LatencySampleCount * SoundOutput.BytesPerSample;
+                    GlobalSecondaryBuffer.BytesBuffered = LatencyBytes - BytesToWrite;
+                    int BytesBuffered = GlobalSecondaryBuffer.BytesBuffered;
+                    SDLRecordAudioLatency(&GlobalAudioStats, (BytesBuffered > 0) ? BytesBuffered : 0);
+
+                    SDL_UnlockAudio();
+                    uint64 FillStart = SDL_GetPerformanceCounter();
+                    SDLFillSoundBuffer(&SoundOutput, ByteToLock, BytesToWrite);
+                    uint64 FillTicks = SDL_GetPerformanceCounter() - FillStart;
+
+                    SDL_LockAudio();
+                    GlobalSecondaryBuffer.BytesBuffered += BytesToWrite;
+                    GlobalAudioStats.WorkTicks += FillTicks;
+                    SDL_UnlockAudio();
                 }
 
-                SDL_UnlockAudio();
-                SDLFillSoundBuffer(&SoundOutput, ByteToLock, BytesToWrite);
+                uint64 Now = SDL_GetPerformanceCounter();
+                if (Now - LastAudioReport >= PerfCountFrequency)
+                {
+                    SDL_LockAudio();
+                    SDLReportAudioStats(AudioBackend, &SoundOutput, Now - LastAudioReport);
+                    SDL_UnlockAudio();
+                    LastAudioReport = Now;
+                }
                 
                 SDLUpdateWindow(Window, Renderer, &GlobalBackbuffer);
 
@@ -685,3 +1000,4 @@ int main(int argc, char *argv[])
     SDL_Quit();
     return(0);
 }
+#endif
@@ -0,0 +1,569 @@
+/*
+ * Microbenchmarks for the hot kernels in sdl_scratch.cpp.
+ *
+ * Usage: scratch_bench [--out=FILE] [--baseline=FILE] [--threshold=PCT]
+ *                      [--trials=N] [--cpu=N] [--window]
+ *
+ * Every kernel runs at a few resolutions / buffer sizes. Each one gets a
+ * warmup, then --trials timed trials, and we keep the median and the fastest
+ * trial (in ns per call). Results are written as JSON to --out (stdout if not
+ * given).
+ *
+ * To keep a baseline, run once with --out=baseline.json on the machine you
+ * care about. Later runs with --baseline=baseline.json compare medians against
+ * it and exit with 1 if any kernel got more than --threshold percent slower
+ * (default 10), or with 2 if none of the baseline's kernels match this run.
+ * Baselines only make sense on the host that recorded them.
+ *
+ * build.sh compiles this with the same CommonFlags as the game, so the numbers
+ * are for the code we actually ship. A baseline is only comparable with runs
+ * built from the same flags.
+ *
+ * By default the texture and present kernels draw through SDL's software
+ * renderer into an offscreen surface, so they run headless and measure the
+ * same work on every host. --window uses a hidden window with the default
+ * (usually GPU) renderer instead, which is closer to what the game does.
+ */
+
+#define SCRATCH_NO_MAIN
+#include "sdl_scratch.cpp"
+
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#define ArrayCount(Array) (sizeof(Array) / sizeof((Array)[0]))
+
+#define MAX_BENCH_RESULTS 64
+#define MAX_BENCH_TRIALS 1000
+
+typedef void bench_kernel(void *Context);
+
+struct bench_result
+{
+    char Name[128];
+    real64 MedianNs;  // Median over trials of the time for one call
+    real64 MinNs;     // Fastest trial
+    int Trials;
+};
+
+struct bench_settings
+{
+    int Trials;
+    real64 WarmupSeconds;    // How long to spin a kernel before timing it
+    real64 TrialSeconds;     // Rough length of one timed trial
+};
+
+global_variable bench_result BenchResults[MAX_BENCH_RESULTS];
+global_variable int BenchResultCount;
+
+/*--------------------------------HARNESS------------------------------------*/
+
+internal int
+CompareReal64(const void *A, const void *B)
+{
+    real64 X = *(const real64 *)A;
+    real64 Y = *(const real64 *)B;
+    return((X > Y) - (X < Y));
+}
+
+/*
+ * Runs Kernel until WarmupSeconds have passed, uses how many calls that took
+ * to pick a call count that makes each trial roughly TrialSeconds long, then
+ * times the trials.
+ */
+internal void
+RunBenchmark(bench_settings *Settings, const char *Name, bench_kernel *Kernel, void *Context)
+{
+    if (BenchResultCount >= MAX_BENCH_RESULTS)
+    {
+        fprintf(stderr, "Too many benchmarks, skipping %s\n", Name);
+        return;
+    }
+
+    real64 TicksPerSecond = (real64)SDL_GetPerformanceFrequency();
+
+    uint64 WarmupStart = SDL_GetPerformanceCounter();
+    uint64 WarmupCalls = 0;
+    uint64 WarmupEnd;
+    do
+    {
+        Kernel(Context);
+        ++WarmupCalls;
+        WarmupEnd = SDL_GetPerformanceCounter();
+    } while ((real64)(WarmupEnd - WarmupStart) < Settings->WarmupSeconds * TicksPerSecond);
+
+    real64 SecondsPerCall = (real64)(WarmupEnd - WarmupStart) / TicksPerSecond / (real64)WarmupCalls;
+    int CallsPerTrial = (int)(Settings->TrialSeconds / SecondsPerCall);
+    if (CallsPerTrial < 1)
+    {
+        CallsPerTrial = 1;
+    }
+
+    real64 TrialNs[MAX_BENCH_TRIALS];
+    for (int TrialIndex = 0; TrialIndex < Settings->Trials; ++TrialIndex)
+    {
+        uint64 Start = SDL_GetPerformanceCounter();
+        for (int CallIndex = 0; CallIndex < CallsPerTrial; ++CallIndex)
+        {
+            Kernel(Context);
+        }
+        uint64 End = SDL_GetPerformanceCounter();
+
+        TrialNs[TrialIndex] = 1.0e9 * (real64)(End - Start) / TicksPerSecond / (real64)CallsPerTrial;
+    }
+    qsort(TrialNs, Settings->Trials, sizeof(TrialNs[0]), CompareReal64);
+
+    bench_result *Result = &BenchResults[BenchResultCount++];
+    snprintf(Result->Name, sizeof(Result->Name), "%s", Name);
+    Result->MedianNs = TrialNs[Settings->Trials / 2];
+    Result->MinNs = TrialNs[0];
+    Result->Trials = Settings->Trials;
+
+    fprintf(stderr, "%-44s median %12.1f ns   min %12.1f ns\n", Result->Name, Result->MedianNs, Result->MinNs);
+}
+
+/*
+ * Keeps the scheduler from moving us between cores halfway through a trial.
+ * Only implemented on Linux; elsewhere we just say so and carry on.
+ */
+internal void
+PinToCPU(int CPU)
+{
+#if defined(__linux__)
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    CPU_SET(CPU, &Set);
+    if (sched_setaffinity(0, sizeof(Set), &Set) != 0)
+    {
+        perror("sched_setaffinity");
+    }
+#else
+    fprintf(stderr, "CPU pinning is not supported on this platform, running unpinned\n");
+#endif
+}
+
+internal void
+WriteResults(FILE *Out)
+{
+    fprintf(Out, "{\n  \"kernels\": [\n");
+    for (int ResultIndex = 0; ResultIndex < BenchResultCount; ++ResultIndex)
+    {
+        bench_result *Result = &BenchResults[ResultIndex];
+        fprintf(Out, "    {\"name\": \"%s\", \"median_ns\": %.1f, \"min_ns\": %.1f, \"trials\": %d}%s\n",
+                Result->Name,
+                Result->MedianNs,
+                Result->MinNs,
+                Result->Trials,
+                (ResultIndex + 1 < BenchResultCount) ? "," : "");
+    }
+    fprintf(Out, "  ]\n}\n");
+}
+
+/*
+ * NOTE(Alex): This is not a JSON parser. It reads back exactly the one
+ * kernel-per-line layout WriteResults produces, so the baseline has to be a
+ * file this program wrote.
+ *
+ * Kernels that are only in the baseline or only in this run get listed, so a
+ * rename doesn't quietly drop a kernel out of the check.
+ *
+ * Returns the number of regressions, or -1 if the baseline can't be read or
+ * none of its kernels match this run.
+ */
+internal int
+CompareAgainstBaseline(const char *BaselinePath, real64 ThresholdPercent)
+{
+    FILE *Baseline = fopen(BaselinePath, "r");
+    if (!Baseline)
+    {
+        perror(BaselinePath);
+        return(-1);
+    }
+
+    int Regressions = 0;
+    int Matched = 0;
+    bool InBaseline[MAX_BENCH_RESULTS] = {};
+    char Line[512];
+    while (fgets(Line, sizeof(Line), Baseline))
+    {
+        char Name[128];
+        real64 BaselineNs;
+        if (sscanf(Line, " {\"name\": \"%127[^\"]\", \"median_ns\": %lf", Name, &BaselineNs) != 2)
+        {
+            continue;
+        }
+
+        bool Found = false;
+        for (int ResultIndex = 0; ResultIndex < BenchResultCount; ++ResultIndex)
+        {
+            bench_result *Result = &BenchResults[ResultIndex];
+            if (strcmp(Result->Name, Name) == 0)
+            {
+                Found = true;
+                InBaseline[ResultIndex] = true;
+                real64 ChangePercent = 100.0 * (Result->MedianNs - BaselineNs) / BaselineNs;
+                bool Regressed = ChangePercent > ThresholdPercent;
+                fprintf(stderr, "%-44s %12.1f -> %12.1f ns  %+7.1f%%%s\n",
+                        Name, BaselineNs, Result->MedianNs, ChangePercent,
+                        Regressed ? "  REGRESSION" : "");
+                Regressions += Regressed;
+                ++Matched;
+                break;
+            }
+        }
+
+        if (!Found)
+        {
+            fprintf(stderr, "%-44s in baseline but not in this run\n", Name);
+        }
+    }
+    fclose(Baseline);
+
+    for (int ResultIndex = 0; ResultIndex < BenchResultCount; ++ResultIndex)
+    {
+        if (!InBaseline[ResultIndex])
+        {
+            fprintf(stderr, "%-44s not in baseline\n", BenchResults[ResultIndex].Name);
+        }
+    }
+
+    if (Matched == 0)
+    {
+        fprintf(stderr, "No kernels in %s matched this run\n", BaselinePath);
+        return(-1);
+    }
+
+    return(Regressions);
+}
+
+/*--------------------------------KERNELS------------------------------------*/
+
+struct gradient_bench
+{
+    sdl_offscreen_buffer Buffer;
+    int Offset;
+};
+
+internal void
+BenchRenderWeirdGradient(void *Context)
+{
+    gradient_bench *Bench = (gradient_bench *)Context;
+    RenderWeirdGradient(&Bench->Buffer, Bench->Offset, Bench->Offset);
+    ++Bench->Offset;
+}
+
+struct fill_bench
+{
+    sdl_sound_output SoundOutput;
+    int BytesToWrite;
+};
+
+internal void
+BenchSDLFillSoundBuffer(void *Context)
+{
+    fill_bench *Bench = (fill_bench *)Context;
+    sdl_sound_output *SoundOutput = &Bench->SoundOutput;
+    int ByteToLock = (SoundOutput->RunningSampleIndex * SoundOutput->BytesPerSample) % SoundOutput->SecondaryBufferSize;
+    SDLFillSoundBuffer(SoundOutput, ByteToLock, Bench->BytesToWrite);
+}
+
+/*
+ * The fill loop as it was before scratch_math.h, kept here so we can see
+ * what the libm sinf version would cost on this machine. It wraps tSine the
+ * same way SDLWriteSineSamples does, so the only difference is the sine.
+ */
+internal void
+BenchSDLFillSoundBufferSinf(void *Context)
+{
+    fill_bench *Bench = (fill_bench *)Context;
+    sdl_sound_output *SoundOutput = &Bench->SoundOutput;
+    int16 *SampleOut = (int16 *)GlobalSecondaryBuffer.Data;
+    int SampleCount = Bench->BytesToWrite / SoundOutput->BytesPerSample;
+
+    for (int SampleIndex = 0;
+        SampleIndex < SampleCount;
+        ++SampleIndex)
+    {
+        real32 SineValue = sinf(SoundOutput->tSine);
+        int16 SampleValue = (int16)(SineValue * SoundOutput->ToneVolume);
+        *SampleOut++ = SampleValue;
+        *SampleOut++ = SampleValue;
+
+        SoundOutput->tSine += (2.0f * Pi32 * 1.0f) / ((real32)SoundOutput->WavePeriod);
+        if (SoundOutput->tSine >= 2.0f * Pi32)
+        {
+            SoundOutput->tSine -= 2.0f * Pi32;
+        }
+        ++SoundOutput->RunningSampleIndex;
+    }
+}
+
+struct callback_bench
+{
+    uint8 *AudioData;
+    int Length;
+};
+
+internal void
+BenchSDLAudioCallback(void *Context)
+{
+    callback_bench *Bench = (callback_bench *)Context;
+    GlobalSecondaryBuffer.BytesBuffered = GlobalSecondaryBuffer.Size;
+    SDLAudioCallback(&GlobalSecondaryBuffer, Bench->AudioData, Bench->Length);
+}
+
+struct texture_bench
+{
+    sdl_offscreen_buffer Buffer;
+    SDL_Renderer *Renderer;
+    int Width;
+    int Height;
+};
+
+internal void
+BenchSDLResizeTexture(void *Context)
+{
+    texture_bench *Bench = (texture_bench *)Context;
+    SDLResizeTexture(&Bench->Buffer, Bench->Renderer, Bench->Width, Bench->Height);
+}
+
+internal void
+BenchSDLUpdateWindow(void *Context)
+{
+    texture_bench *Bench = (texture_bench *)Context;
+    SDLUpdateWindow(0, Bench->Renderer, &Bench->Buffer);
+}
+
+/*---------------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+    const char *OutPath = 0;
+    const char *BaselinePath = 0;
+    real64 ThresholdPercent = 10.0;
+    int CPU = 0;
+    bool UseWindow = false;
+
+    bench_settings Settings = {};
+    Settings.Trials = 31;
+    Settings.WarmupSeconds = 0.1;
+    Settings.TrialSeconds = 0.01;
+
+    for (int ArgIndex = 1; ArgIndex < argc; ++ArgIndex)
+    {
+        char *Arg = argv[ArgIndex];
+        if (strncmp(Arg, "--out=", 6) == 0)
+        {
+            OutPath = Arg + 6;
+        }
+        else if (strncmp(Arg, "--baseline=", 11) == 0)
+        {
+            BaselinePath = Arg + 11;
+        }
+        else if (strncmp(Arg, "--threshold=", 12) == 0)
+        {
+            ThresholdPercent = atof(Arg + 12);
+        }
+        else if (strncmp(Arg, "--trials=", 9) == 0)
+        {
+            Settings.Trials = atoi(Arg + 9);
+        }
+        else if (strncmp(Arg, "--cpu=", 6) == 0)
+        {
+            CPU = atoi(Arg + 6);
+        }
+        else if (strcmp(Arg, "--window") == 0)
+        {
+            UseWindow = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument %s\n", Arg);
+            return(2);
+        }
+    }
+
+    if (Settings.Trials < 1 || Settings.Trials > MAX_BENCH_TRIALS)
+    {
+        fprintf(stderr, "--trials must be between 1 and %d\n", MAX_BENCH_TRIALS);
+        return(2);
+    }
+
+    PinToCPU(CPU);
+
+    /* NOTE(Alex):
+     * Surfaces, the software renderer and the performance counter all work
+     * without the video subsystem, and on a box with no display initing it
+     * fails outright. Only --window actually needs it.
+     */
+    if (SDL_Init(UseWindow ? SDL_INIT_VIDEO : 0) != 0)
+    {
+        fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+        return(2);
+    }
+
+    char Name[128];
+    int Resolutions[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+    int AudioSampleCounts[] = {512, 2048, 8192};
+
+    // RenderWeirdGradient ---------------------------------------------------
+    for (int ResIndex = 0; ResIndex < (int)ArrayCount(Resolutions); ++ResIndex)
+    {
+        gradient_bench Bench = {};
+        Bench.Buffer.Width = Resolutions[ResIndex][0];
+        Bench.Buffer.Height = Resolutions[ResIndex][1];
+        Bench.Buffer.Pitch = Bench.Buffer.Width * 4;
+        Bench.Buffer.Memory = calloc(Bench.Buffer.Pitch * Bench.Buffer.Height, 1);
+
+        snprintf(Name, sizeof(Name), "RenderWeirdGradient/%dx%d", Bench.Buffer.Width, Bench.Buffer.Height);
+        RunBenchmark(&Settings, Name, BenchRenderWeirdGradient, &Bench);
+
+        free(Bench.Buffer.Memory);
+    }
+
+    // Audio -----------------------------------------------------------------
+    sdl_sound_output SoundOutput = {};
+    SoundOutput.SamplesPerSecond = 48000;
+    SoundOutput.ToneHz = 256;
+    SoundOutput.ToneVolume = 3000;
+    SoundOutput.WavePeriod = SoundOutput.SamplesPerSecond / SoundOutput.ToneHz;
+    SoundOutput.BytesPerSample = sizeof(int16) * 2;
+    SoundOutput.SecondaryBufferSize = SoundOutput.SamplesPerSecond * SoundOutput.BytesPerSample;
+    SoundOutput.LatencySampleCount = SoundOutput.SamplesPerSecond / 15;
+
+    GlobalSecondaryBuffer.Size = SoundOutput.SecondaryBufferSize;
+    GlobalSecondaryBuffer.Data = calloc(GlobalSecondaryBuffer.Size, 1);
+
+    for (int SizeIndex = 0; SizeIndex < (int)ArrayCount(AudioSampleCounts); ++SizeIndex)
+    {
+        int SampleCount = AudioSampleCounts[SizeIndex];
+
+        fill_bench Fill = {};
+        Fill.SoundOutput = SoundOutput;
+        Fill.BytesToWrite = SampleCount * SoundOutput.BytesPerSample;
+
+        snprintf(Name, sizeof(Name), "SDLFillSoundBuffer/%d", SampleCount);
+        RunBenchmark(&Settings, Name, BenchSDLFillSoundBuffer, &Fill);
+
+        Fill.SoundOutput = SoundOutput;
+        snprintf(Name, sizeof(Name), "SDLFillSoundBuffer_sinf/%d", SampleCount);
+        RunBenchmark(&Settings, Name, BenchSDLFillSoundBufferSinf, &Fill);
+
+        callback_bench Callback = {};
+        Callback.Length = SampleCount * SoundOutput.BytesPerSample;
+        Callback.AudioData = (uint8 *)calloc(Callback.Length, 1);
+
+        snprintf(Name, sizeof(Name), "SDLAudioCallback/%d", SampleCount);
+        RunBenchmark(&Settings, Name, BenchSDLAudioCallback, &Callback);
+
+        free(Callback.AudioData);
+    }
+
+    // Texture and present ---------------------------------------------------
+    SDL_Window *Window = 0;
+    if (UseWindow)
+    {
+        Window = SDL_CreateWindow("scratch_bench",
+                                  SDL_WINDOWPOS_UNDEFINED,
+                                  SDL_WINDOWPOS_UNDEFINED,
+                                  640,
+                                  480,
+                                  SDL_WINDOW_HIDDEN);
+        if (!Window)
+        {
+            fprintf(stderr, "Could not create a window: %s\n", SDL_GetError());
+            return(2);
+        }
+    }
+
+    for (int ResIndex = 0; ResIndex < (int)ArrayCount(Resolutions); ++ResIndex)
+    {
+        int Width = Resolutions[ResIndex][0];
+        int Height = Resolutions[ResIndex][1];
+
+        SDL_Surface *Surface = 0;
+        SDL_Renderer *Renderer = 0;
+        if (Window)
+        {
+            SDL_SetWindowSize(Window, Width, Height);
+            Renderer = SDL_CreateRenderer(Window, -1, 0);
+        }
+        else
+        {
+            Surface = SDL_CreateRGBSurfaceWithFormat(0, Width, Height, 32, SDL_PIXELFORMAT_ARGB8888);
+            Renderer = SDL_CreateSoftwareRenderer(Surface);
+        }
+
+        if (!Renderer)
+        {
+            fprintf(stderr, "Could not create a renderer: %s\n", SDL_GetError());
+            return(2);
+        }
+
+        texture_bench Bench = {};
+        Bench.Renderer = Renderer;
+        Bench.Width = Width;
+        Bench.Height = Height;
+
+        snprintf(Name, sizeof(Name), "SDLResizeTexture/%dx%d", Width, Height);
+        RunBenchmark(&Settings, Name, BenchSDLResizeTexture, &Bench);
+
+        RenderWeirdGradient(&Bench.Buffer, 0, 0);
+        snprintf(Name, sizeof(Name), "SDLUpdateWindow/%dx%d", Width, Height);
+        RunBenchmark(&Settings, Name, BenchSDLUpdateWindow, &Bench);
+
+        munmap(Bench.Buffer.Memory, Bench.Buffer.Width * Bench.Buffer.Height * 4);
+        SDL_DestroyTexture(Bench.Buffer.Texture);
+        SDL_DestroyRenderer(Renderer);
+        if (Surface)
+        {
+            SDL_FreeSurface(Surface);
+        }
+    }
+
+    if (Window)
+    {
+        SDL_DestroyWindow(Window);
+    }
+    SDL_Quit();
+
+    // Report ----------------------------------------------------------------
+
+    /* Compare before writing in case --out and --baseline are the same file */
+    int Result = 0;
+    if (BaselinePath)
+    {
+        int Regressions = CompareAgainstBaseline(BaselinePath, ThresholdPercent);
+        if (Regressions < 0)
+        {
+            Result = 2;
+        }
+        else if (Regressions > 0)
+        {
+            fprintf(stderr, "%d kernel(s) regressed by more than %.1f%%\n", Regressions, ThresholdPercent);
+            Result = 1;
+        }
+    }
+
+    if (OutPath)
+    {
+        FILE *Out = fopen(OutPath, "w");
+        if (!Out)
+        {
+            perror(OutPath);
+            return(2);
+        }
+        WriteResults(Out);
+        fclose(Out);
+    }
+    else
+    {
+        WriteResults(stdout);
+    }
+
+    return(Result);
+}